@@ -39,15 +39,132 @@
 #include <vector>
 #include <cmath>
 #include <limits>
+#include <new>
+#include <map>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
 
 namespace py = pybind11;
 
+// First slice of slab s when splitting depth slices into n slabs
+inline int slabBegin(int depth, int n, int s)
+{
+    return static_cast<int>(static_cast<int64_t>(depth) * s / n);
+}
+
+// Allocator for the per-voxel region state. Default-constructed elements are left
+// uninitialized, so pages are first touched by whoever initializes them. With hugePages,
+// the storage is 2 MiB aligned and backed by transparent huge pages (Linux only).
+template <typename V>
+struct RegionAllocator
+{
+    using value_type = V;
+    static constexpr size_t hugePageSize = 2 << 20;
+
+    bool hugePages = false;
+
+    RegionAllocator() = default;
+    explicit RegionAllocator(bool hugePages) : hugePages(hugePages) {}
+    template <typename U>
+    RegionAllocator(const RegionAllocator<U> &other) : hugePages(other.hugePages) {}
+
+    V *allocate(size_t n);
+    void deallocate(V *p, size_t n);
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) { ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...); }
+    template <typename U>
+    void construct(U *p) { ::new (static_cast<void *>(p)) U; }
+
+    template <typename U>
+    bool operator==(const RegionAllocator<U> &other) const { return hugePages == other.hugePages; }
+    template <typename U>
+    bool operator!=(const RegionAllocator<U> &other) const { return hugePages != other.hugePages; }
+
+private:
+    static size_t hugeBytes(size_t n) { return (n * sizeof(V) + hugePageSize - 1) / hugePageSize * hugePageSize; }
+};
+
+template <typename V>
+V *RegionAllocator<V>::allocate(size_t n)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages)
+    {
+        // Over-allocate to align the start to a huge page, then give back the slack
+        size_t bytes = hugeBytes(n);
+        void *p = mmap(nullptr, bytes + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        uintptr_t start = reinterpret_cast<uintptr_t>(p);
+        uintptr_t aligned = (start + hugePageSize - 1) / hugePageSize * hugePageSize;
+        if (aligned > start)
+            munmap(p, aligned - start);
+        munmap(reinterpret_cast<void *>(aligned + bytes), start + hugePageSize - aligned);
+        madvise(reinterpret_cast<void *>(aligned), bytes, MADV_HUGEPAGE);
+        return reinterpret_cast<V *>(aligned);
+    }
+#endif
+    return std::allocator<V>().allocate(n);
+}
+
+template <typename V>
+void RegionAllocator<V>::deallocate(V *p, size_t n)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages)
+    {
+        munmap(p, hugeBytes(n));
+        return;
+    }
+#endif
+    std::allocator<V>().deallocate(p, n);
+}
+
+template <typename V>
+using RegionVector = std::vector<V, RegionAllocator<V>>;
+
+// Thrown when the merge stops early because cancel() was called
+class SegmentationCancelled : public std::runtime_error
+{
+public:
+    explicit SegmentationCancelled(uint64_t bucket)
+        : std::runtime_error("Segmentation cancelled at bucket " + std::to_string(bucket)) {}
+};
+
 template <typename T, int Dimensions>
 class SRM
 {
 public:
-    // Constructor
-    SRM(const double Q);
+    // Constructor. nThreads first-touch the region state, hugePages backs it with huge pages
+    SRM(const double Q, int nThreads = 1, bool hugePages = false);
 
     // Destructor
     virtual ~SRM() {}
@@ -55,9 +172,32 @@ public:
     // Perform the segmentation
     virtual void segment();
 
+    // Continue a cancelled segmentation, or one loaded with loadCheckpoint
+    void resume();
+
+    // Stop the merge at the next bucket boundary. Safe to call from another thread; a request made
+    // before the merge starts stops it at its first bucket. Cleared when a merge ends
+    void cancel() { cancelRequested = true; }
+
+    // Call callback(processedBuckets, totalBuckets) at most once per interval seconds during the merge.
+    // This and setCheckpoint raise while a merge runs
+    void setProgressCallback(std::function<void(uint64_t, uint64_t)> callback, double interval);
+
+    // Write a checkpoint to path every interval seconds during the merge, and when it is cancelled.
+    // A checkpoint that cannot be written is reported on stderr and the merge goes on
+    void setCheckpoint(const std::string &path, double interval);
+
+    // Save or restore the merge state (region stats and bucket cursor) at a bucket boundary.
+    // While a merge runs, saving is only allowed from the progress callback
+    void saveCheckpoint(const std::string &path) const;
+    void loadCheckpoint(const std::string &path);
+
     // Get the segmentation result as an array of region labels
     virtual py::array_t<T> getSegmentation() const = 0;
 
+    // Report the size, huge page backing and NUMA nodes of the region state
+    py::dict getMemoryPlacement() const;
+
 protected:
     double Q;             // Parameter Q
     unsigned long long g; // Some constant
@@ -66,15 +206,28 @@ protected:
 
     std::vector<int64_t> nextNeighbor;
     std::vector<int64_t> neighborBucket;
-    std::vector<double> average;
-    std::vector<uint64_t> count;
-    std::vector<int64_t> regionIndex;
+    int nThreads;
+    RegionVector<double> average;
+    RegionVector<uint64_t> count;
+    RegionVector<int64_t> regionIndex;
+
+    // Allocate the region state of nSlices slices, first touched in parallel slabs
+    void allocateRegions(uint64_t sliceSize, int nSlices);
+
+    // Image width, height and depth, recorded in checkpoints
+    uint64_t extent[3] = {1, 1, 1};
+
+    // Next gradient bucket to merge
+    uint64_t bucketCursor = 0;
+
+    // Called by mergeAllNeighbors after each non-empty bucket. Returns false to stop the merge
+    bool bucketDone(uint64_t bucket);
 
     // Initialize each voxel as its own region
     virtual void initializeRegions() = 0;
 
     virtual void initializeNeighbors() = 0;
-    void addNeighborPair(uint64_t neighborID, const T *pixel, T *nextPixel, int i);
+    void addNeighborPair(uint64_t neighborID, const T *pixel, const T *nextPixel, int i);
     void addNeighborPair(uint64_t neighborID, const T *pixel, int i, int j);
 
     int64_t getRegionIndex(int64_t i);
@@ -91,16 +244,150 @@ protected:
     virtual void updateAverages() = 0;
 
     // int consolidateRegions();
+
+private:
+    bool regionsInitialized = false; // set by segment() and loadCheckpoint()
+
+    // Held by segment(), resume(), the checkpoint calls and the setters. Recursive so the progress
+    // callback, which runs on the merging thread at a bucket boundary, can save a checkpoint
+    mutable std::recursive_mutex stateMutex;
+    bool merging = false;
+    std::atomic<bool> cancelRequested{false};
+    std::function<void(uint64_t, uint64_t)> progressCallback;
+    std::chrono::duration<double> progressInterval{1.0};
+    std::string checkpointPath;
+    std::chrono::duration<double> checkpointInterval{0.0};
+    std::chrono::steady_clock::time_point lastProgress, lastCheckpoint;
+
+    // Merge from bucketCursor to the end and finish the segmentation
+    void finishMerge();
+
+    // Write the checkpoint set by setCheckpoint, logging a failure instead of stopping the merge
+    void writeCheckpoint();
 };
 
 // Constructor
 template <typename T, int Dimensions>
-SRM<T, Dimensions>::SRM(double Q)
-    : Q(Q), g(static_cast<unsigned long long>(std::numeric_limits<T>::max()) + 1), factor((g * g) / (2 * Q)) {}
+SRM<T, Dimensions>::SRM(double Q, int nThreads, bool hugePages)
+    : Q(Q), g(static_cast<unsigned long long>(std::numeric_limits<T>::max()) + 1), factor((g * g) / (2 * Q)),
+      nThreads(std::max(1, nThreads)), average(RegionAllocator<double>(hugePages)),
+      count(RegionAllocator<uint64_t>(hugePages)), regionIndex(RegionAllocator<int64_t>(hugePages)) {}
+
+// Allocate the region stats. Each thread first touches the slab of slices it would work on,
+// so that on NUMA machines the pages land on the node of that thread
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::allocateRegions(uint64_t sliceSize, int nSlices)
+{
+    uint64_t len = sliceSize * nSlices;
+    average.resize(len);
+    count.resize(len);
+    regionIndex.resize(len);
+
+    auto touch = [this](uint64_t begin, uint64_t end)
+    {
+        std::fill(average.begin() + begin, average.begin() + end, 0.0);
+        std::fill(count.begin() + begin, count.begin() + end, 0);
+        std::fill(regionIndex.begin() + begin, regionIndex.begin() + end, -1);
+    };
+
+    // More threads than cores or slices only adds overhead
+    int n = std::min(nThreads, nSlices);
+    unsigned int cores = std::thread::hardware_concurrency();
+    if (cores > 0)
+        n = std::min(n, static_cast<int>(cores));
+    n = std::max(1, n);
+
+    std::vector<std::thread> threads;
+    try
+    {
+        for (int s = 1; s < n; s++)
+            threads.emplace_back(touch, sliceSize * slabBegin(nSlices, n, s), sliceSize * slabBegin(nSlices, n, s + 1));
+    }
+    catch (...)
+    {
+        // Joinable threads must not be destroyed, so wait for the ones already started
+        for (std::thread &thread : threads)
+            thread.join();
+        throw;
+    }
+    touch(0, sliceSize * slabBegin(nSlices, n, 1));
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+// Size, huge page backing and NUMA placement of one array
+inline py::dict memoryPlacement(const void *data, size_t bytes)
+{
+    py::dict placement;
+    placement["bytes"] = bytes;
+    uint64_t hugePageBytes = 0;
+    std::map<int, uint64_t> nodes;
+
+#if defined(__linux__)
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data), end = begin + bytes;
+
+    // Huge pages of the mappings overlapping the array
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    uintptr_t mapBegin = 0, mapEnd = 0;
+    while (std::getline(smaps, line))
+    {
+        unsigned long long a, b;
+        if (std::sscanf(line.c_str(), "%llx-%llx ", &a, &b) == 2)
+        {
+            mapBegin = a;
+            mapEnd = b;
+        }
+        else if (line.rfind("AnonHugePages:", 0) == 0 && mapBegin < end && begin < mapEnd)
+        {
+            uint64_t kB = 0;
+            std::istringstream(line.substr(14)) >> kB;
+            uint64_t overlap = std::min(end, mapEnd) - std::max(begin, mapBegin);
+            hugePageBytes += std::min(kB * 1024, overlap);
+        }
+    }
+
+#ifdef SYS_move_pages
+    // NUMA node of a sample of the pages
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t nPages = (end - begin + pageSize - 1) / pageSize;
+    uint64_t nSamples = std::min<uint64_t>(nPages, 4096);
+    std::vector<void *> pages(nSamples);
+    std::vector<int> status(nSamples, -1);
+    for (uint64_t i = 0; i < nSamples; i++)
+        pages[i] = reinterpret_cast<void *>((begin + i * nPages / nSamples * pageSize) / pageSize * pageSize);
+    if (nSamples > 0 && syscall(SYS_move_pages, 0, nSamples, pages.data(), nullptr, status.data(), 0) == 0)
+    {
+        for (int node : status)
+        {
+            if (node >= 0)
+                nodes[node] += bytes / nSamples;
+        }
+    }
+#endif
+#endif
+
+    placement["huge_page_bytes"] = hugePageBytes;
+    py::dict numaNodes;
+    for (const auto &node : nodes)
+        numaNodes[py::int_(node.first)] = node.second;
+    placement["numa_nodes"] = numaNodes;
+    return placement;
+}
+
+template <typename T, int Dimensions>
+py::dict SRM<T, Dimensions>::getMemoryPlacement() const
+{
+    py::dict placement;
+    placement["average"] = memoryPlacement(average.data(), average.size() * sizeof(double));
+    placement["count"] = memoryPlacement(count.data(), count.size() * sizeof(uint64_t));
+    placement["regionIndex"] = memoryPlacement(regionIndex.data(), regionIndex.size() * sizeof(int64_t));
+    return placement;
+}
 
 // Function to add neighbor pair to bucket
 template <typename T, int Dimensions>
-void SRM<T, Dimensions>::addNeighborPair(uint64_t neighborID, const T *pixel, T *nextPixel, int i)
+void SRM<T, Dimensions>::addNeighborPair(uint64_t neighborID, const T *pixel, const T *nextPixel, int i)
 {
     T difference = std::abs(static_cast<long long>(pixel[i]) - static_cast<long long>(nextPixel[i]));
     nextNeighbor[neighborID] = neighborBucket[difference];
@@ -166,10 +453,228 @@ void SRM<T, Dimensions>::mergeRegions(int64_t i1, int64_t i2)
 template <typename T, int Dimensions>
 void SRM<T, Dimensions>::segment()
 {
+    std::unique_lock<std::recursive_mutex> lock(stateMutex, std::try_to_lock);
+    if (!lock || merging)
+        throw std::runtime_error("Error: The merge state is in use by another call");
+
     initializeRegions();
+    regionsInitialized = true;
     initializeNeighbors();
-    mergeAllNeighbors();
+    bucketCursor = 0;
+    finishMerge();
+}
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::resume()
+{
+    std::unique_lock<std::recursive_mutex> lock(stateMutex, std::try_to_lock);
+    if (!lock || merging)
+        throw std::runtime_error("Error: The merge state is in use by another call");
+    if (!regionsInitialized)
+        throw std::runtime_error("Error: Nothing to resume, call segment() or load_checkpoint() first");
+
+    if (neighborBucket.empty())
+        initializeNeighbors();
+    finishMerge();
+}
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::finishMerge()
+{
+    lastProgress = lastCheckpoint = std::chrono::steady_clock::now();
+    merging = true;
+    try
+    {
+        mergeAllNeighbors();
+    }
+    catch (...)
+    {
+        merging = false;
+        cancelRequested = false;
+        throw;
+    }
+    merging = false;
+    cancelRequested = false;
+
+    if (bucketCursor < g)
+    {
+        if (!checkpointPath.empty())
+            writeCheckpoint();
+        throw SegmentationCancelled(bucketCursor);
+    }
+    if (progressCallback)
+        progressCallback(g, g);
     updateAverages();
 }
 
+template <typename T, int Dimensions>
+bool SRM<T, Dimensions>::bucketDone(uint64_t bucket)
+{
+    bucketCursor = bucket + 1;
+    if (!progressCallback && checkpointPath.empty())
+        return !cancelRequested;
+
+    auto now = std::chrono::steady_clock::now();
+    if (progressCallback && now - lastProgress >= progressInterval)
+    {
+        lastProgress = now;
+        progressCallback(bucketCursor, g);
+    }
+    if (!checkpointPath.empty() && now - lastCheckpoint >= checkpointInterval)
+    {
+        lastCheckpoint = now;
+        writeCheckpoint();
+    }
+    return !cancelRequested;
+}
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::writeCheckpoint()
+{
+    try
+    {
+        saveCheckpoint(checkpointPath);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Checkpoint not written: " << e.what() << std::endl;
+    }
+}
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::setProgressCallback(std::function<void(uint64_t, uint64_t)> callback, double interval)
+{
+    // The merging thread calls the callback, so it cannot be replaced until the merge ends
+    std::unique_lock<std::recursive_mutex> lock(stateMutex, std::try_to_lock);
+    if (!lock || merging)
+        throw std::runtime_error("Error: Cannot set the progress callback while the merge runs");
+    progressCallback = std::move(callback);
+    progressInterval = std::chrono::duration<double>(interval);
+}
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::setCheckpoint(const std::string &path, double interval)
+{
+    std::unique_lock<std::recursive_mutex> lock(stateMutex, std::try_to_lock);
+    if (!lock || merging)
+        throw std::runtime_error("Error: Cannot set the checkpoint while the merge runs");
+    checkpointPath = path;
+    checkpointInterval = std::chrono::duration<double>(interval);
+}
+
+// Checkpoint layout, in native byte order:
+//   char[8] magic, uint32 version, uint32 dimensions, uint32 sizeof(T), uint32 reserved,
+//   uint64 width, uint64 height, uint64 depth, double Q, uint64 bucketCursor,
+//   int64 regionIndex[voxels], uint64 count[voxels], double average[voxels]
+static constexpr char checkpointMagic[8] = {'D', 'P', 'M', 'S', 'R', 'M', 'C', 'K'};
+static constexpr uint32_t checkpointVersion = 2;
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::saveCheckpoint(const std::string &path) const
+{
+    // Fails while another thread merges, so the state written is always at a bucket boundary
+    std::unique_lock<std::recursive_mutex> lock(stateMutex, std::try_to_lock);
+    if (!lock)
+        throw std::runtime_error("Error: Cannot save a checkpoint while the merge runs, "
+                                 "save it from the progress callback or use set_checkpoint");
+    if (!regionsInitialized)
+        throw std::runtime_error("Error: Nothing to checkpoint, call segment() first");
+
+    // Write next to the target and rename, so a preempted write never clobbers the last checkpoint
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Error: Could not open checkpoint " + tmpPath);
+
+        uint32_t header[4] = {checkpointVersion, static_cast<uint32_t>(Dimensions), static_cast<uint32_t>(sizeof(T)), 0};
+        uint64_t voxels = regionIndex.size();
+        out.write(checkpointMagic, sizeof(checkpointMagic));
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(extent), sizeof(extent));
+        out.write(reinterpret_cast<const char *>(&Q), sizeof(Q));
+        out.write(reinterpret_cast<const char *>(&bucketCursor), sizeof(bucketCursor));
+        out.write(reinterpret_cast<const char *>(regionIndex.data()), voxels * sizeof(int64_t));
+        out.write(reinterpret_cast<const char *>(count.data()), voxels * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char *>(average.data()), voxels * sizeof(double));
+        out.flush();
+        if (!out)
+            throw std::runtime_error("Error: Could not write checkpoint " + tmpPath);
+    }
+#if defined(_WIN32)
+    // std::rename fails on Windows when the previous checkpoint exists
+    bool moved = MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool moved = std::rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!moved)
+        throw std::runtime_error("Error: Could not move checkpoint to " + path);
+}
+
+template <typename T, int Dimensions>
+void SRM<T, Dimensions>::loadCheckpoint(const std::string &path)
+{
+    std::unique_lock<std::recursive_mutex> lock(stateMutex, std::try_to_lock);
+    if (!lock || merging)
+        throw std::runtime_error("Error: Cannot load a checkpoint while the merge runs");
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Error: Could not open checkpoint " + path);
+
+    char magic[8];
+    uint32_t header[4];
+    uint64_t shape[3], cursor;
+    double q;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!in || std::memcmp(magic, checkpointMagic, sizeof(magic)) != 0)
+        throw std::runtime_error("Error: " + path + " is not a checkpoint");
+    if (header[0] != checkpointVersion)
+    {
+        std::cerr << "Checkpoint version " << header[0] << ", expected " << checkpointVersion << std::endl;
+        throw std::runtime_error("Error: Unsupported checkpoint version");
+    }
+    in.read(reinterpret_cast<char *>(shape), sizeof(shape));
+    in.read(reinterpret_cast<char *>(&q), sizeof(q));
+    in.read(reinterpret_cast<char *>(&cursor), sizeof(cursor));
+    if (!in)
+        throw std::runtime_error("Error: Truncated checkpoint " + path);
+
+    // The merge state only makes sense for the same image geometry, pixel type and Q
+    if (header[1] != Dimensions || header[2] != sizeof(T) || !std::equal(shape, shape + 3, extent) || q != Q || cursor > g)
+    {
+        std::cerr << "Checkpoint has " << header[1] << "D, " << 8 * header[2] << "-bit, shape (" << shape[2] << ", "
+                  << shape[1] << ", " << shape[0] << "), Q = " << q << ", but the image has " << Dimensions << "D, "
+                  << 8 * sizeof(T) << "-bit, shape (" << extent[2] << ", " << extent[1] << ", " << extent[0]
+                  << "), Q = " << Q << std::endl;
+        throw std::runtime_error("Error: Checkpoint does not match the image");
+    }
+
+    // The region state is overwritten from here on, so it is only usable again if the whole load succeeds
+    uint64_t voxels = regionIndex.size();
+    regionsInitialized = false;
+    in.read(reinterpret_cast<char *>(regionIndex.data()), voxels * sizeof(int64_t));
+    in.read(reinterpret_cast<char *>(count.data()), voxels * sizeof(uint64_t));
+    in.read(reinterpret_cast<char *>(average.data()), voxels * sizeof(double));
+    if (!in)
+        throw std::runtime_error("Error: Truncated checkpoint " + path);
+
+    // Roots point to themselves and every other region to a smaller index (see mergeRegions),
+    // which also guarantees that getRegionIndex terminates
+    for (uint64_t i = 0; i < voxels; i++)
+    {
+        int64_t parent = regionIndex[i];
+        bool valid = parent >= 0 ? static_cast<uint64_t>(parent) == i && count[i] > 0
+                                 : static_cast<uint64_t>(-1 - parent) < i;
+        if (!valid)
+        {
+            std::cerr << "Invalid region index " << parent << " at voxel " << i << std::endl;
+            throw std::runtime_error("Error: Checkpoint holds an invalid region tree");
+        }
+    }
+    bucketCursor = cursor;
+    regionsInitialized = true;
+}
+
 #endif // SRM_HPP
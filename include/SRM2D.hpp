@@ -49,7 +49,7 @@ class SRM2D : public SRM<T, 2>
 {
 public:
     // Constructor
-    SRM2D(const py::array_t<T> &img, double Q);
+    SRM2D(const py::array_t<T> &img, double Q, int nThreads = 1, bool hugePages = false);
     ~SRM2D() {}
 
     // Get the segmentation result as a 2D array of region labels
@@ -68,8 +68,8 @@ private:
 
 // SRM3D constructor
 template <typename T>
-SRM2D<T>::SRM2D(const py::array_t<T> &img, double q)
-    : SRM<T, 2>(q), width(img.shape(1)), height(img.shape(0))
+SRM2D<T>::SRM2D(const py::array_t<T> &img, double q, int nThreads, bool hugePages)
+    : SRM<T, 2>(q, nThreads, hugePages), width(img.shape(1)), height(img.shape(0))
 {
     // Access pointer to np array
     py::buffer_info buf = img.request();
@@ -95,10 +95,10 @@ SRM2D<T>::SRM2D(const py::array_t<T> &img, double q)
         throw std::runtime_error("Error: img_ptr is null!"); // or handle the error appropriately
     }
 
-    // Initialize region stats
-    this->average.resize(width * height, 0.0);
-    this->count.resize(width * height, 0);
-    this->regionIndex.resize(width * height, -1);
+    // Initialize region stats, first touched by blocks of rows
+    this->allocateRegions(width, height);
+    this->extent[0] = width;
+    this->extent[1] = height;
 
     // Calculate factor and logDelta based on image dimensions
     this->delta = 1.0f / (6 * width * height);            // delta = 1 / (6 * w * h * d)
@@ -124,7 +124,8 @@ void SRM2D<T>::initializeNeighbors()
 {
     // Create a vector to store the neighbors of each voxel
     this->nextNeighbor.resize(2 * width * height);
-    this->neighborBucket.resize(static_cast<uint64_t>(this->g), -1);
+    // Start from empty buckets, segment() may run again after a cancel
+    this->neighborBucket.assign(static_cast<uint64_t>(this->g), -1);
 
     // Bucket sort
     // Allocate memory on the heap for nextPixel
@@ -156,9 +157,11 @@ void SRM2D<T>::mergeAllNeighbors()
 {
     uint64_t len = static_cast<uint64_t>(this->g);
 
-    for (uint64_t i = 0; i < len; ++i)
+    for (uint64_t i = this->bucketCursor; i < len; ++i)
     {
         int64_t neighborIndex = this->neighborBucket[i];
+        if (neighborIndex < 0)
+            continue;
 
         while (neighborIndex >= 0)
         {
@@ -172,7 +175,12 @@ void SRM2D<T>::mergeAllNeighbors()
 
             neighborIndex = this->nextNeighbor[neighborIndex];
         }
+
+        // Progress, checkpoints and cancellation at bucket boundaries
+        if (!SRM<T, 2>::bucketDone(i))
+            return;
     }
+    this->bucketCursor = len;
 }
 
 // TODO: Check original code for what this is doing
@@ -49,13 +49,18 @@ class SRM3D : public SRM<T, 3>
 {
 public:
     // Constructor
-    SRM3D(const py::array_t<T> &img, double Q);
+    SRM3D(const py::array_t<T> &img, double Q, int nThreads = 1, bool hugePages = false);
+    // Constructor from a raw C-contiguous (depth, height, width) buffer
+    SRM3D(const T *img, int width, int height, int depth, double Q, int nThreads = 1, bool hugePages = false);
     ~SRM3D() {}
 
     // Get the segmentation result as a 3D array of region labels
     py::array_t<T> getSegmentation() const override;
 
-private:
+    // Validate the np array and return a pointer to its data
+    static const T *requestImagePointer(const py::array_t<T> &img);
+
+protected:
     const T *img_ptr;
     const int width, height, depth;
 
@@ -66,10 +71,9 @@ private:
     void updateAverages() override;
 };
 
-// SRM3D constructor
+// Validate the np array and return a pointer to its data
 template <typename T>
-SRM3D<T>::SRM3D(const py::array_t<T> &img, double q)
-    : SRM<T, 3>(q), width(img.shape(2)), height(img.shape(1)), depth(img.shape(0))
+const T *SRM3D<T>::requestImagePointer(const py::array_t<T> &img)
 {
     // Access pointer to np array
     py::buffer_info buf = img.request();
@@ -87,18 +91,30 @@ SRM3D<T>::SRM3D(const py::array_t<T> &img, double q)
         throw std::runtime_error("Error: Incorrect data type"); // Handle the error accordingly
     }
 
-    img_ptr = static_cast<const T *>(buf.ptr);
+    return static_cast<const T *>(buf.ptr);
+}
 
+// SRM3D constructor
+template <typename T>
+SRM3D<T>::SRM3D(const py::array_t<T> &img, double q, int nThreads, bool hugePages)
+    : SRM3D(requestImagePointer(img), img.shape(2), img.shape(1), img.shape(0), q, nThreads, hugePages) {}
+
+// SRM3D constructor from a raw buffer
+template <typename T>
+SRM3D<T>::SRM3D(const T *img, int width, int height, int depth, double q, int nThreads, bool hugePages)
+    : SRM<T, 3>(q, nThreads, hugePages), img_ptr(img), width(width), height(height), depth(depth)
+{
     if (!img_ptr)
     {
         std::cerr << "img_ptr is null!" << std::endl;
         throw std::runtime_error("Error: img_ptr is null!"); // or handle the error appropriately
     }
 
-    // Initialize region stats
-    this->average.resize(width * height * depth, 0.0);
-    this->count.resize(width * height * depth, 0);
-    this->regionIndex.resize(width * height * depth, -1);
+    // Initialize region stats, first touched by z-slab
+    this->allocateRegions(static_cast<uint64_t>(width) * height, depth);
+    this->extent[0] = width;
+    this->extent[1] = height;
+    this->extent[2] = depth;
 
     // Calculate factor and logDelta based on image dimensions
     this->delta = 1.0f / (6 * width * height * depth);            // delta = 1 / (6 * w * h * d)
@@ -128,7 +144,8 @@ void SRM3D<T>::initializeNeighbors()
 {
     // Create a vector to store the neighbors of each voxel
     this->nextNeighbor.resize(3 * width * height * depth);
-    this->neighborBucket.resize(static_cast<uint64_t>(this->g), -1);
+    // Start from empty buckets, segment() may run again after a cancel
+    this->neighborBucket.assign(static_cast<uint64_t>(this->g), -1);
 
     // Bucket sort
     // Allocate memory on the heap for nextPixel
@@ -173,9 +190,11 @@ void SRM3D<T>::mergeAllNeighbors()
 {
     uint64_t len = static_cast<uint64_t>(this->g);
 
-    for (uint64_t i = 0; i < len; ++i)
+    for (uint64_t i = this->bucketCursor; i < len; ++i)
     {
         int64_t neighborIndex = this->neighborBucket[i];
+        if (neighborIndex < 0)
+            continue;
 
         while (neighborIndex >= 0)
         {
@@ -201,7 +220,12 @@ void SRM3D<T>::mergeAllNeighbors()
 
             neighborIndex = this->nextNeighbor[neighborIndex];
         }
+
+        // Progress, checkpoints and cancellation at bucket boundaries
+        if (!SRM<T, 3>::bucketDone(i))
+            return;
     }
+    this->bucketCursor = len;
 }
 
 // TODO: Check original code for what this is doing
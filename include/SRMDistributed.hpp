@@ -0,0 +1,373 @@
+#ifndef SRMDISTRIBUTED_HPP
+#define SRMDISTRIBUTED_HPP
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
+#include "SRMSlab.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DPM_SRM_HAVE_FORK 1
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef DPM_SRM_WITH_MPI
+#include <mpi.h>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#endif
+
+namespace py = pybind11;
+
+#ifdef DPM_SRM_HAVE_FORK
+
+// Write exactly bytes to a pipe
+inline bool writeAll(int fd, const void *data, uint64_t bytes)
+{
+    const char *buffer = static_cast<const char *>(data);
+    while (bytes > 0)
+    {
+        ssize_t written = write(fd, buffer, bytes);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        buffer += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+// Read exactly bytes from a pipe
+inline bool readAll(int fd, void *data, uint64_t bytes)
+{
+    char *buffer = static_cast<char *>(data);
+    while (bytes > 0)
+    {
+        ssize_t received = read(fd, buffer, bytes);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        buffer += received;
+        bytes -= received;
+    }
+    return true;
+}
+
+// Write a length-prefixed message to a pipe
+inline bool writeMessage(int fd, const void *data, uint64_t bytes)
+{
+    return writeAll(fd, &bytes, sizeof(bytes)) && writeAll(fd, data, bytes);
+}
+
+// Read a length-prefixed message from a pipe
+inline bool readMessage(int fd, std::vector<char> &out)
+{
+    uint64_t bytes;
+    if (!readAll(fd, &bytes, sizeof(bytes)))
+        return false;
+    out.resize(bytes);
+    return readAll(fd, out.data(), bytes);
+}
+
+// Segment a 3D volume by splitting it along z into nProcs slabs, each segmented in a forked
+// process. The slabs write their result into shared memory and exchange their face tables
+// with the parent through pipes, which merges them across the slab boundaries.
+template <typename T>
+py::array_t<T> segmentSlabsForked(const py::array_t<T> &img, double Q, int nProcs)
+{
+    const T *img_ptr = SRM3D<T>::requestImagePointer(img);
+    const int width = img.shape(2), height = img.shape(1), depth = img.shape(0);
+    const uint64_t faceSize = static_cast<uint64_t>(width) * height;
+    const uint64_t bytes = faceSize * depth * sizeof(T);
+    nProcs = std::max(1, std::min(nProcs, depth));
+
+    // Output shared between all slab processes
+    void *shared = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        throw std::runtime_error("Error: Could not map shared memory for the segmentation");
+    T *shared_ptr = static_cast<T *>(shared);
+
+    std::vector<pid_t> pids;
+    std::vector<int> toChild, fromChild;
+    auto cleanup = [&](bool killChildren)
+    {
+        for (int fd : toChild)
+            close(fd);
+        for (int fd : fromChild)
+            close(fd);
+        toChild.clear();
+        fromChild.clear();
+        bool failed = false;
+        for (pid_t pid : pids)
+        {
+            if (killChildren)
+                kill(pid, SIGKILL);
+            int status;
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        pids.clear();
+        return !failed;
+    };
+
+    for (int s = 0; s < nProcs; s++)
+    {
+        int z0 = slabBegin(depth, nProcs, s), z1 = slabBegin(depth, nProcs, s + 1);
+        int up[2], down[2];
+        if (pipe(up) != 0)
+        {
+            cleanup(true);
+            munmap(shared, bytes);
+            throw std::runtime_error("Error: Could not create pipe");
+        }
+        if (pipe(down) != 0)
+        {
+            close(up[0]);
+            close(up[1]);
+            cleanup(true);
+            munmap(shared, bytes);
+            throw std::runtime_error("Error: Could not create pipe");
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // Slab process: never touch the Python API here
+            for (int fd : toChild)
+                close(fd);
+            for (int fd : fromChild)
+                close(fd);
+            close(up[0]);
+            close(down[1]);
+            try
+            {
+                SRM3DSlab<T> slab(img_ptr + z0 * faceSize, width, height, z1 - z0, Q, z0, depth);
+                slab.segmentInterior();
+                std::vector<char> table = slab.getFaceTable().serialize();
+                std::vector<char> message;
+                if (!writeMessage(up[1], table.data(), table.size()) || !readMessage(down[0], message))
+                    _exit(1);
+
+                std::vector<double> averages(message.size() / sizeof(double));
+                std::memcpy(averages.data(), message.data(), averages.size() * sizeof(double));
+                slab.applyBoundaryMerge(averages);
+                slab.writeSegmentation(shared_ptr + z0 * faceSize);
+            }
+            catch (...)
+            {
+                _exit(1);
+            }
+            _exit(0);
+        }
+
+        close(up[1]);
+        close(down[0]);
+        if (pid < 0)
+        {
+            close(up[0]);
+            close(down[1]);
+            cleanup(true);
+            munmap(shared, bytes);
+            throw std::runtime_error("Error: Could not fork slab process");
+        }
+        pids.push_back(pid);
+        fromChild.push_back(up[0]);
+        toChild.push_back(down[1]);
+    }
+
+    bool ok = true;
+    {
+        py::gil_scoped_release release;
+        try
+        {
+            // Collect the face tables in z order and merge across the slab boundaries
+            SlabBoundaryMerger<T> merger(width, height, depth, Q);
+            std::vector<char> message;
+            for (int s = 0; s < nProcs; s++)
+            {
+                if (!readMessage(fromChild[s], message))
+                    throw std::runtime_error("Error: Slab process failed during segmentation");
+                merger.addSlab(SlabFaceTable<T>::deserialize(message.data(), message.size()));
+            }
+            merger.segment();
+
+            for (int s = 0; s < nProcs; s++)
+            {
+                std::vector<double> averages = merger.getSlabAverages(s);
+                if (!writeMessage(toChild[s], averages.data(), averages.size() * sizeof(double)))
+                    throw std::runtime_error("Error: Slab process failed during boundary merge");
+            }
+            ok = cleanup(false);
+        }
+        catch (...)
+        {
+            cleanup(true);
+            munmap(shared, bytes);
+            throw;
+        }
+    }
+
+    if (!ok)
+    {
+        munmap(shared, bytes);
+        throw std::runtime_error("Error: Slab process failed during boundary merge");
+    }
+
+    auto result_array = py::array_t<T>({depth, height, width});
+    auto result_buf_info = result_array.request();
+    std::memcpy(result_buf_info.ptr, shared, bytes);
+    munmap(shared, bytes);
+    return result_array;
+}
+
+#endif // DPM_SRM_HAVE_FORK
+
+#ifdef DPM_SRM_WITH_MPI
+
+// Segment the slab owned by this MPI rank. Every rank of MPI_COMM_WORLD calls this with its
+// own slab; rank 0 gathers the face tables, merges across the slab boundaries and scatters
+// the merged region averages back. Returns the segmented slab.
+// Before each exchange the ranks agree on whether the previous step succeeded everywhere, so an
+// error on one rank raises on all of them instead of leaving the others blocked.
+template <typename T>
+py::array_t<T> segmentSlabMPI(const py::array_t<T> &slab, double Q, int zOffset, int globalDepth)
+{
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized)
+    {
+        MPI_Init(nullptr, nullptr);
+        std::atexit([]
+                    {
+                        int finalized;
+                        MPI_Finalized(&finalized);
+                        if (!finalized)
+                            MPI_Finalize(); });
+    }
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // Raise the local error, or a generic one if the failure happened on another rank
+    auto checkAllRanks = [](const std::string &error, const char *step)
+    {
+        int ok = error.empty(), allOk;
+        MPI_Allreduce(&ok, &allOk, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if (!error.empty())
+            throw std::runtime_error(error);
+        if (!allOk)
+            throw std::runtime_error(std::string("Error: ") + step + " failed on another rank");
+    };
+
+    // Segment the slab interior
+    std::unique_ptr<SRM3DSlab<T>> srm;
+    SlabFaceTable<T> table;
+    std::vector<char> bytes;
+    std::string error;
+    try
+    {
+        srm = std::make_unique<SRM3DSlab<T>>(slab, Q, zOffset, globalDepth);
+        srm->segmentInterior();
+        table = srm->getFaceTable();
+        if (rank != 0)
+        {
+            bytes = table.serialize();
+            // Face tables are sent to rank 0 one by one, so only each single message is bounded by INT_MAX
+            if (bytes.size() > INT_MAX)
+                throw std::runtime_error("Error: Slab face table is too large for MPI");
+        }
+    }
+    catch (const std::exception &e)
+    {
+        error = e.what();
+        if (error.empty())
+            error = "Error: Slab segmentation failed";
+    }
+    checkAllRanks(error, "Slab segmentation");
+
+    std::vector<double> local(table.regionIds.size());
+    const int tableTag = 0, averageTag = 1;
+    if (rank != 0)
+    {
+        MPI_Send(bytes.data(), static_cast<int>(bytes.size()), MPI_CHAR, 0, tableTag, MPI_COMM_WORLD);
+    }
+
+    // Receive every face table first, then merge across slab boundaries in z order,
+    // which need not match the rank order
+    std::vector<std::vector<double>> averages(size);
+    if (rank == 0)
+    {
+        std::vector<std::vector<char>> messages(size);
+        for (int r = 1; r < size; r++)
+        {
+            MPI_Status status;
+            int count;
+            MPI_Probe(r, tableTag, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_CHAR, &count);
+            messages[r].resize(count);
+            MPI_Recv(messages[r].data(), count, MPI_CHAR, r, tableTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+
+        try
+        {
+            std::vector<SlabFaceTable<T>> tables(size);
+            tables[0] = std::move(table);
+            for (int r = 1; r < size; r++)
+                tables[r] = SlabFaceTable<T>::deserialize(messages[r].data(), messages[r].size());
+
+            std::vector<int> order(size);
+            for (int r = 0; r < size; r++)
+                order[r] = r;
+            std::sort(order.begin(), order.end(), [&tables](int a, int b)
+                      { return tables[a].zOffset < tables[b].zOffset; });
+
+            SlabBoundaryMerger<T> merger(tables[0].width, tables[0].height, globalDepth, Q);
+            for (int r : order)
+                merger.addSlab(std::move(tables[r]));
+            merger.segment();
+
+            for (int s = 0; s < size; s++)
+                averages[order[s]] = merger.getSlabAverages(s);
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+            if (error.empty())
+                error = "Error: Boundary merge failed";
+        }
+    }
+    checkAllRanks(error, "Boundary merge");
+
+    if (rank == 0)
+    {
+        local = std::move(averages[0]);
+        for (int r = 1; r < size; r++)
+            MPI_Send(averages[r].data(), static_cast<int>(averages[r].size()), MPI_DOUBLE, r, averageTag, MPI_COMM_WORLD);
+    }
+    else
+    {
+        MPI_Recv(local.data(), static_cast<int>(local.size()), MPI_DOUBLE, 0, averageTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+
+    srm->applyBoundaryMerge(local);
+    return srm->getSegmentation();
+}
+
+#endif // DPM_SRM_WITH_MPI
+
+#endif // SRMDISTRIBUTED_HPP
@@ -0,0 +1,421 @@
+#ifndef SRMSLAB_HPP
+#define SRMSLAB_HPP
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "SRM.hpp"
+#include "SRM3D.hpp"
+
+namespace py = pybind11;
+
+// Boundary faces of one z-slab and the stats of every region touching them.
+// Region ids are global voxel indices (z * height * width + y * width + x) of the region roots.
+template <typename T>
+struct SlabFaceTable
+{
+    int32_t width = 0, height = 0;
+    int32_t zOffset = 0, depth = 0;
+
+    // Pixel values and region ids of the first (lower) and last (upper) slice of the slab.
+    // Empty when the slab has no neighbor on that side.
+    std::vector<T> lowerPixels, upperPixels;
+    std::vector<int64_t> lowerRegions, upperRegions;
+
+    // Sorted, unique roots referenced by the faces
+    std::vector<int64_t> regionIds;
+    std::vector<uint64_t> counts;
+    std::vector<double> averages;
+
+    // Compact binary form: fixed header followed by the raw arrays
+    std::vector<char> serialize() const;
+    static SlabFaceTable<T> deserialize(const char *data, size_t size);
+};
+
+template <typename T>
+std::vector<char> SlabFaceTable<T>::serialize() const
+{
+    uint64_t faceSize = static_cast<uint64_t>(width) * height;
+    uint64_t nRegions = regionIds.size();
+    uint8_t hasLower = !lowerPixels.empty();
+    uint8_t hasUpper = !upperPixels.empty();
+
+    std::vector<char> out;
+    auto append = [&out](const void *src, size_t bytes)
+    {
+        const char *p = static_cast<const char *>(src);
+        out.insert(out.end(), p, p + bytes);
+    };
+
+    append(&width, sizeof(width));
+    append(&height, sizeof(height));
+    append(&zOffset, sizeof(zOffset));
+    append(&depth, sizeof(depth));
+    append(&nRegions, sizeof(nRegions));
+    append(&hasLower, sizeof(hasLower));
+    append(&hasUpper, sizeof(hasUpper));
+    if (hasLower)
+    {
+        append(lowerPixels.data(), faceSize * sizeof(T));
+        append(lowerRegions.data(), faceSize * sizeof(int64_t));
+    }
+    if (hasUpper)
+    {
+        append(upperPixels.data(), faceSize * sizeof(T));
+        append(upperRegions.data(), faceSize * sizeof(int64_t));
+    }
+    append(regionIds.data(), nRegions * sizeof(int64_t));
+    append(counts.data(), nRegions * sizeof(uint64_t));
+    append(averages.data(), nRegions * sizeof(double));
+    return out;
+}
+
+template <typename T>
+SlabFaceTable<T> SlabFaceTable<T>::deserialize(const char *data, size_t size)
+{
+    SlabFaceTable<T> table;
+    size_t pos = 0;
+    auto extract = [&](void *dst, size_t bytes)
+    {
+        if (pos + bytes > size)
+            throw std::runtime_error("Error: Truncated slab face table");
+        std::memcpy(dst, data + pos, bytes);
+        pos += bytes;
+    };
+
+    uint64_t nRegions;
+    uint8_t hasLower, hasUpper;
+    extract(&table.width, sizeof(table.width));
+    extract(&table.height, sizeof(table.height));
+    extract(&table.zOffset, sizeof(table.zOffset));
+    extract(&table.depth, sizeof(table.depth));
+    extract(&nRegions, sizeof(nRegions));
+    extract(&hasLower, sizeof(hasLower));
+    extract(&hasUpper, sizeof(hasUpper));
+
+    uint64_t faceSize = static_cast<uint64_t>(table.width) * table.height;
+    if (hasLower)
+    {
+        table.lowerPixels.resize(faceSize);
+        table.lowerRegions.resize(faceSize);
+        extract(table.lowerPixels.data(), faceSize * sizeof(T));
+        extract(table.lowerRegions.data(), faceSize * sizeof(int64_t));
+    }
+    if (hasUpper)
+    {
+        table.upperPixels.resize(faceSize);
+        table.upperRegions.resize(faceSize);
+        extract(table.upperPixels.data(), faceSize * sizeof(T));
+        extract(table.upperRegions.data(), faceSize * sizeof(int64_t));
+    }
+    table.regionIds.resize(nRegions);
+    table.counts.resize(nRegions);
+    table.averages.resize(nRegions);
+    extract(table.regionIds.data(), nRegions * sizeof(int64_t));
+    extract(table.counts.data(), nRegions * sizeof(uint64_t));
+    extract(table.averages.data(), nRegions * sizeof(double));
+    return table;
+}
+
+// Segments one z-slab of a larger volume. Only edges inside the slab are merged here;
+// edges crossing the slab faces are merged afterwards by SlabBoundaryMerger.
+template <typename T>
+class SRM3DSlab : public SRM3D<T>
+{
+public:
+    // Constructor. img points to the slab only, zOffset is its first slice in the full volume
+    SRM3DSlab(const T *img, int width, int height, int depth, double Q, int zOffset, int globalDepth);
+    SRM3DSlab(const py::array_t<T> &img, double Q, int zOffset, int globalDepth);
+    ~SRM3DSlab() {}
+
+    // Merge all edges inside the slab, keeping the region trees for the boundary merge
+    void segmentInterior();
+
+    // Export the faces shared with the neighboring slabs
+    SlabFaceTable<T> getFaceTable() const;
+
+    // Apply the merged averages, ordered as the regionIds of getFaceTable(), and finish the segmentation
+    void applyBoundaryMerge(const std::vector<double> &averages);
+
+    // Write the segmented slab into a (depth, height, width) buffer
+    void writeSegmentation(T *out) const;
+
+private:
+    const int zOffset, globalDepth;
+
+    int64_t getRootIndex(int64_t i) const;
+};
+
+// SRM3DSlab constructor
+template <typename T>
+SRM3DSlab<T>::SRM3DSlab(const T *img, int width, int height, int depth, double q, int zOffset, int globalDepth)
+    : SRM3D<T>(img, width, height, depth, q), zOffset(zOffset), globalDepth(globalDepth)
+{
+    if (zOffset < 0 || depth <= 0 || zOffset + depth > globalDepth)
+    {
+        std::cerr << "Slab [" << zOffset << ", " << zOffset + depth << ") is outside of depth " << globalDepth << std::endl;
+        throw std::runtime_error("Error: Invalid slab extent");
+    }
+
+    // Use the statistics of the full volume so the predicate matches the serial segmentation
+    uint64_t globalSize = static_cast<uint64_t>(width) * height * globalDepth;
+    this->delta = 1.0f / (6 * globalSize);
+    this->logDelta = 2.0f * std::log(6 * globalSize);
+}
+
+// SRM3DSlab constructor from a np array holding the slab
+template <typename T>
+SRM3DSlab<T>::SRM3DSlab(const py::array_t<T> &img, double q, int zOffset, int globalDepth)
+    : SRM3DSlab(SRM3D<T>::requestImagePointer(img), img.shape(2), img.shape(1), img.shape(0), q, zOffset, globalDepth) {}
+
+// Same as getRegionIndex, usable from const members
+template <typename T>
+int64_t SRM3DSlab<T>::getRootIndex(int64_t i) const
+{
+    i = this->regionIndex[i];
+    while (i < 0)
+        i = this->regionIndex[-1 - i];
+    return i;
+}
+
+template <typename T>
+void SRM3DSlab<T>::segmentInterior()
+{
+    this->initializeRegions();
+    this->initializeNeighbors();
+    this->mergeAllNeighbors();
+
+    // The neighbor lists are not needed anymore
+    std::vector<int64_t>().swap(this->nextNeighbor);
+    std::vector<int64_t>().swap(this->neighborBucket);
+}
+
+template <typename T>
+SlabFaceTable<T> SRM3DSlab<T>::getFaceTable() const
+{
+    const int width = this->width, height = this->height, depth = this->depth;
+    uint64_t faceSize = static_cast<uint64_t>(width) * height;
+    int64_t globalOffset = static_cast<int64_t>(zOffset) * faceSize;
+
+    SlabFaceTable<T> table;
+    table.width = width;
+    table.height = height;
+    table.zOffset = zOffset;
+    table.depth = depth;
+
+    auto exportFace = [&](int k, std::vector<T> &pixels, std::vector<int64_t> &regions)
+    {
+        const T *pixel = this->img_ptr + k * faceSize;
+        pixels.assign(pixel, pixel + faceSize);
+        regions.resize(faceSize);
+        for (uint64_t i = 0; i < faceSize; i++)
+            regions[i] = globalOffset + getRootIndex(k * faceSize + i);
+        table.regionIds.insert(table.regionIds.end(), regions.begin(), regions.end());
+    };
+
+    if (zOffset > 0)
+        exportFace(0, table.lowerPixels, table.lowerRegions);
+    if (zOffset + depth < globalDepth)
+        exportFace(depth - 1, table.upperPixels, table.upperRegions);
+
+    std::sort(table.regionIds.begin(), table.regionIds.end());
+    table.regionIds.erase(std::unique(table.regionIds.begin(), table.regionIds.end()), table.regionIds.end());
+    for (int64_t id : table.regionIds)
+    {
+        table.counts.push_back(this->count[id - globalOffset]);
+        table.averages.push_back(this->average[id - globalOffset]);
+    }
+    return table;
+}
+
+template <typename T>
+void SRM3DSlab<T>::applyBoundaryMerge(const std::vector<double> &averages)
+{
+    std::vector<int64_t> faceRegionIds = getFaceTable().regionIds;
+    if (averages.size() != faceRegionIds.size())
+        throw std::runtime_error("Error: Boundary merge does not match the slab face table");
+
+    int64_t globalOffset = static_cast<int64_t>(zOffset) * this->width * this->height;
+    for (size_t i = 0; i < faceRegionIds.size(); i++)
+        this->average[faceRegionIds[i] - globalOffset] = averages[i];
+
+    this->updateAverages();
+}
+
+template <typename T>
+void SRM3DSlab<T>::writeSegmentation(T *out) const
+{
+    uint64_t len = static_cast<uint64_t>(this->width) * this->height * this->depth;
+    for (uint64_t i = 0; i < len; i++)
+        out[i] = static_cast<T>(this->average[i]);
+}
+
+// Merges regions across slab boundaries in gradient order, using the face tables of all slabs.
+template <typename T>
+class SlabBoundaryMerger : public SRM<T, 3>
+{
+public:
+    // Constructor
+    SlabBoundaryMerger(int width, int height, int globalDepth, double Q);
+    ~SlabBoundaryMerger() {}
+
+    // Add the face table of the next slab, in increasing z order
+    void addSlab(SlabFaceTable<T> table);
+
+    // Merged averages of the regions of one slab, ordered as its regionIds
+    std::vector<double> getSlabAverages(size_t slab) const;
+
+    // Get the merged averages of all boundary regions, in the order they were added
+    py::array_t<T> getSegmentation() const override;
+
+private:
+    const int width, height, globalDepth;
+    std::vector<SlabFaceTable<T>> slabs;
+    std::vector<size_t> slabStart; // first merger index of each slab's regions
+    std::vector<int64_t> edgeRegions; // merger indices of both regions of each boundary edge
+
+    void initializeRegions() override;
+    void initializeNeighbors() override;
+    void mergeAllNeighbors() override;
+    void updateAverages() override;
+};
+
+// SlabBoundaryMerger constructor
+template <typename T>
+SlabBoundaryMerger<T>::SlabBoundaryMerger(int width, int height, int globalDepth, double q)
+    : SRM<T, 3>(q), width(width), height(height), globalDepth(globalDepth)
+{
+    uint64_t globalSize = static_cast<uint64_t>(width) * height * globalDepth;
+    this->delta = 1.0f / (6 * globalSize);
+    this->logDelta = 2.0f * std::log(6 * globalSize);
+}
+
+template <typename T>
+void SlabBoundaryMerger<T>::addSlab(SlabFaceTable<T> table)
+{
+    int expectedOffset = slabs.empty() ? 0 : slabs.back().zOffset + slabs.back().depth;
+    if (table.width != width || table.height != height || table.zOffset != expectedOffset)
+    {
+        std::cerr << "Expected slab at z = " << expectedOffset << ", but got z = " << table.zOffset << std::endl;
+        throw std::runtime_error("Error: Slabs must be contiguous and added in z order");
+    }
+    slabs.push_back(std::move(table));
+}
+
+// Initialize each boundary region with its slab-local stats
+template <typename T>
+void SlabBoundaryMerger<T>::initializeRegions()
+{
+    if (slabs.empty() || slabs.back().zOffset + slabs.back().depth != globalDepth)
+        throw std::runtime_error("Error: Slabs do not cover the full volume");
+
+    slabStart.clear();
+    for (const SlabFaceTable<T> &slab : slabs)
+    {
+        slabStart.push_back(this->regionIndex.size());
+        for (size_t i = 0; i < slab.regionIds.size(); i++)
+        {
+            this->average.push_back(slab.averages[i]);
+            this->count.push_back(slab.counts[i]);
+            this->regionIndex.push_back(this->regionIndex.size());
+        }
+    }
+}
+
+// Bucket sort the edges between the upper face of each slab and the lower face of the next
+template <typename T>
+void SlabBoundaryMerger<T>::initializeNeighbors()
+{
+    uint64_t faceSize = static_cast<uint64_t>(width) * height;
+    uint64_t nEdges = (slabs.size() - 1) * faceSize;
+    this->nextNeighbor.resize(nEdges);
+    this->neighborBucket.assign(static_cast<uint64_t>(this->g), -1);
+    edgeRegions.resize(2 * nEdges);
+
+    // Global region id -> merger index, for both faces of one boundary
+    auto localIndex = [this](size_t s, int64_t id)
+    {
+        const std::vector<int64_t> &ids = slabs[s].regionIds;
+        return static_cast<int64_t>(slabStart[s] + (std::lower_bound(ids.begin(), ids.end(), id) - ids.begin()));
+    };
+
+    for (int64_t s = slabs.size() - 2; s >= 0; s--)
+    {
+        const SlabFaceTable<T> &lower = slabs[s], &upper = slabs[s + 1];
+        for (int64_t i = faceSize - 1; i >= 0; i--)
+        {
+            uint64_t neighborIndex = s * faceSize + i;
+            edgeRegions[2 * neighborIndex] = localIndex(s, lower.upperRegions[i]);
+            edgeRegions[2 * neighborIndex + 1] = localIndex(s + 1, upper.lowerRegions[i]);
+            SRM<T, 3>::addNeighborPair(neighborIndex, lower.upperPixels.data(), upper.lowerPixels.data(), i);
+        }
+    }
+}
+
+// Merge regions based on the predicate criterion
+template <typename T>
+void SlabBoundaryMerger<T>::mergeAllNeighbors()
+{
+    uint64_t len = static_cast<uint64_t>(this->g);
+
+    for (uint64_t i = this->bucketCursor; i < len; ++i)
+    {
+        int64_t neighborIndex = this->neighborBucket[i];
+        if (neighborIndex < 0)
+            continue;
+
+        while (neighborIndex >= 0)
+        {
+            int64_t i1 = SRM<T, 3>::getRegionIndex(edgeRegions[2 * neighborIndex]);
+            int64_t i2 = SRM<T, 3>::getRegionIndex(edgeRegions[2 * neighborIndex + 1]);
+            if (i1 != i2 && SRM<T, 3>::predicate(i1, i2))
+                SRM<T, 3>::mergeRegions(i1, i2);
+
+            neighborIndex = this->nextNeighbor[neighborIndex];
+        }
+
+        // Progress, checkpoints and cancellation at bucket boundaries
+        if (!SRM<T, 3>::bucketDone(i))
+            return;
+    }
+    this->bucketCursor = len;
+}
+
+template <typename T>
+void SlabBoundaryMerger<T>::updateAverages()
+{
+    for (uint64_t i = 0; i < this->average.size(); i++)
+    {
+        this->average[i] = this->average[SRM<T, 3>::getRegionIndex(i)];
+    }
+}
+
+template <typename T>
+std::vector<double> SlabBoundaryMerger<T>::getSlabAverages(size_t slab) const
+{
+    auto first = this->average.begin() + slabStart.at(slab);
+    return std::vector<double>(first, first + slabs[slab].regionIds.size());
+}
+
+template <typename T>
+py::array_t<T> SlabBoundaryMerger<T>::getSegmentation() const
+{
+    auto result_array = py::array_t<T>(this->average.size());
+    auto result_buf_info = result_array.request();
+    T *result_ptr = static_cast<T *>(result_buf_info.ptr);
+
+    for (uint64_t i = 0; i < this->average.size(); i++)
+    {
+        result_ptr[i] = static_cast<T>(this->average[i]);
+    }
+    return result_array;
+}
+
+#endif // SRMSLAB_HPP
@@ -1,12 +1,38 @@
+import os
+import shlex
+import subprocess
 from setuptools import setup, find_packages
 import pybind11
 from pybind11.setup_helpers import Pybind11Extension
 
+
+def mpi_flags():
+    """Compile and link flags of the MPI compiler wrapper (Open MPI or MPICH)."""
+    mpicxx = os.environ.get("MPICXX", "mpicxx")
+    try:
+        compile_flags = subprocess.check_output([mpicxx, "--showme:compile"], text=True)
+        link_flags = subprocess.check_output([mpicxx, "--showme:link"], text=True)
+    except (OSError, subprocess.CalledProcessError):
+        # MPICH prints the full command line, starting with the underlying compiler
+        compile_flags = " ".join(shlex.split(subprocess.check_output([mpicxx, "-compile_info"], text=True))[1:])
+        link_flags = " ".join(shlex.split(subprocess.check_output([mpicxx, "-link_info"], text=True))[1:])
+    return shlex.split(compile_flags), shlex.split(link_flags)
+
+
+# Optional MPI backend for the slab-decomposed 3D segmentation: DPM_SRM_WITH_MPI=1 pip install .
+define_macros, extra_compile_args, extra_link_args = [], [], []
+if os.environ.get("DPM_SRM_WITH_MPI", "0") not in ("", "0"):
+    extra_compile_args, extra_link_args = mpi_flags()
+    define_macros.append(("DPM_SRM_WITH_MPI", None))
+
 ext_modules = [
     Pybind11Extension(
         'dpm_srm',
         ['wrappers/wrapper.cpp'],
         include_dirs=["./include", pybind11.get_include()],
+        define_macros=define_macros,
+        extra_compile_args=extra_compile_args,
+        extra_link_args=extra_link_args,
         language='c++'
     ),
 ]
@@ -20,13 +20,15 @@ print("Starting segmentation...")
 tick = perf_counter_ns()
 
 # Create an instance of the SRM3D class
-srm16 = SRM3D_u16(image_u16, Q=5.0)
+# (n_threads first-touch the region state, huge_pages backs it with transparent huge pages)
+srm16 = SRM3D_u16(image_u16, Q=5.0, n_threads=4, huge_pages=True)
 # srm8_2d = SRM2D(image_8_2d, Q=5.0)
 
 # Perform segmentation
 srm16.segment()
 # srm8_2d.segment()
 print(f"{(perf_counter_ns() - tick) * 1e-9 : .4f}s")
+print(srm16.memory_placement())
 
 
 # Get the results
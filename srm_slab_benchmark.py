@@ -0,0 +1,61 @@
+"""Scaling benchmark for the slab-decomposed 3D segmentation.
+
+Process pool (single node):
+    python srm_slab_benchmark.py
+MPI (build with DPM_SRM_WITH_MPI=1 pip install ., requires mpi4py):
+    mpirun -np 4 python srm_slab_benchmark.py --mpi
+"""
+import sys
+import numpy as np
+import dpm_srm
+from time import perf_counter_ns
+
+np.random.seed(130621)
+shape = (256, 256, 256)
+Q = 5.0
+
+
+def make_image():
+    return np.random.randint(0, 256, size=shape, dtype=np.uint8)
+
+
+def benchmark_forked(image):
+    tick = perf_counter_ns()
+    srm = dpm_srm.SRM3D_u8(image, Q=Q)
+    srm.segment()
+    serial = srm.get_result()
+    t_serial = (perf_counter_ns() - tick) * 1e-9
+    print(f"serial: {t_serial : .4f}s")
+
+    for n_procs in (1, 2, 4, 8, 16):
+        tick = perf_counter_ns()
+        result = dpm_srm.segment_slabs_u8(image, Q=Q, n_procs=n_procs)
+        elapsed = (perf_counter_ns() - tick) * 1e-9
+        mismatch = np.count_nonzero(result != serial) / result.size
+        print(f"n_procs={n_procs:3d}: {elapsed : .4f}s  speedup {t_serial / elapsed : .2f}  "
+              f"voxels differing from serial {100 * mismatch : .2f}%")
+
+
+def benchmark_mpi(image):
+    from mpi4py import MPI
+    comm = MPI.COMM_WORLD
+    rank, size = comm.Get_rank(), comm.Get_size()
+
+    depth = shape[0]
+    z0, z1 = depth * rank // size, depth * (rank + 1) // size
+    slab = np.ascontiguousarray(image[z0:z1])
+
+    comm.Barrier()
+    tick = perf_counter_ns()
+    dpm_srm.segment_slab_mpi_u8(slab, Q=Q, z_offset=z0, global_depth=depth)
+    comm.Barrier()
+    if rank == 0:
+        print(f"ranks={size:3d}: {(perf_counter_ns() - tick) * 1e-9 : .4f}s")
+
+
+if __name__ == "__main__":
+    image = make_image()
+    if "--mpi" in sys.argv:
+        benchmark_mpi(image)
+    else:
+        benchmark_forked(image)
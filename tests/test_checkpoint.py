@@ -0,0 +1,165 @@
+import numpy as np
+import pytest
+import dpm_srm
+
+Q = 5.0
+
+
+@pytest.fixture
+def image():
+    rng = np.random.default_rng(130621)
+    return rng.integers(0, 65536, size=(20, 30, 40), dtype=np.uint16)
+
+
+def segment(image):
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    srm.segment()
+    return srm.get_result()
+
+
+def cancel_midway(srm):
+    """Cancel once, a third of the way through the buckets."""
+    state = {"cancelled": False}
+
+    def progress(done, total):
+        if not state["cancelled"] and done > total // 3:
+            state["cancelled"] = True
+            srm.cancel()
+
+    srm.set_progress_callback(progress, interval=0.0)
+    with pytest.raises(dpm_srm.SegmentationCancelled):
+        srm.segment()
+
+
+def test_cancel_and_resume_matches_uninterrupted(image):
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    cancel_midway(srm)
+    srm.resume()
+    np.testing.assert_array_equal(srm.get_result(), segment(image))
+
+
+def test_segment_after_cancel_matches_uninterrupted(image):
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    cancel_midway(srm)
+    srm.segment()
+    np.testing.assert_array_equal(srm.get_result(), segment(image))
+
+
+def test_cancel_and_resume_from_checkpoint_matches_uninterrupted(image, tmp_path):
+    path = str(tmp_path / "srm.ckpt")
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    srm.set_checkpoint(path, interval=1e9)  # only written on cancellation
+    cancel_midway(srm)
+
+    resumed = dpm_srm.SRM3D_u16(image, Q=Q)
+    resumed.load_checkpoint(path)
+    resumed.resume()
+    np.testing.assert_array_equal(resumed.get_result(), segment(image))
+
+
+def test_checkpoint_saved_from_progress_callback(image, tmp_path):
+    path = str(tmp_path / "srm.ckpt")
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    state = {"saved": False}
+
+    def progress(done, total):
+        if not state["saved"] and done > total // 2:
+            state["saved"] = True
+            srm.save_checkpoint(path)
+
+    srm.set_progress_callback(progress, interval=0.0)
+    srm.segment()
+
+    resumed = dpm_srm.SRM3D_u16(image, Q=Q)
+    resumed.load_checkpoint(path)
+    resumed.resume()
+    np.testing.assert_array_equal(resumed.get_result(), srm.get_result())
+
+
+def test_cancel_and_resume_2d():
+    rng = np.random.default_rng(7)
+    image = rng.integers(0, 256, size=(120, 90), dtype=np.uint8)
+    reference = dpm_srm.SRM2D_u8(image, Q=Q)
+    reference.segment()
+
+    srm = dpm_srm.SRM2D_u8(image, Q=Q)
+    cancel_midway(srm)
+    srm.resume()
+    np.testing.assert_array_equal(srm.get_result(), reference.get_result())
+
+
+def test_periodic_checkpoints_replace_each_other(tmp_path):
+    rng = np.random.default_rng(11)
+    image = rng.integers(0, 256, size=(120, 90), dtype=np.uint8)
+    path = str(tmp_path / "srm.ckpt")
+    srm = dpm_srm.SRM2D_u8(image, Q=Q)
+    srm.set_checkpoint(path, interval=0.0)  # rewritten after every bucket
+    srm.segment()
+
+    resumed = dpm_srm.SRM2D_u8(image, Q=Q)
+    resumed.load_checkpoint(path)
+    resumed.resume()
+    np.testing.assert_array_equal(resumed.get_result(), srm.get_result())
+
+
+def test_unwritable_checkpoint_does_not_stop_the_merge(image, tmp_path):
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    srm.set_checkpoint(str(tmp_path / "missing" / "srm.ckpt"), interval=0.0)
+    srm.segment()
+    np.testing.assert_array_equal(srm.get_result(), segment(image))
+
+
+def test_setters_raise_while_merging(image):
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    errors = []
+
+    def progress(done, total):
+        if not errors:
+            for setter in (lambda: srm.set_progress_callback(print), lambda: srm.set_checkpoint("unused.ckpt")):
+                try:
+                    setter()
+                except RuntimeError as e:
+                    errors.append(e)
+
+    srm.set_progress_callback(progress, interval=0.0)
+    srm.segment()
+    assert len(errors) == 2
+    srm.set_progress_callback(print, interval=60.0)  # allowed again once the merge ended
+
+
+def test_resume_without_state_raises(image):
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    with pytest.raises(RuntimeError):
+        srm.resume()
+    with pytest.raises(RuntimeError):
+        srm.save_checkpoint("unused.ckpt")
+
+
+@pytest.mark.parametrize("other", [
+    lambda image: dpm_srm.SRM3D_u16(image.reshape(20, 40, 30), Q=Q),  # same voxel count
+    lambda image: dpm_srm.SRM3D_u16(image, Q=2 * Q),
+    lambda image: dpm_srm.SRM3D_u8(image.astype(np.uint8), Q=Q),
+])
+def test_load_rejects_mismatched_checkpoint(image, tmp_path, other):
+    path = str(tmp_path / "srm.ckpt")
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    srm.segment()
+    srm.save_checkpoint(path)
+
+    mismatched = other(image)
+    with pytest.raises(RuntimeError):
+        mismatched.load_checkpoint(path)
+
+
+def test_load_rejects_truncated_checkpoint(image, tmp_path):
+    path = tmp_path / "srm.ckpt"
+    srm = dpm_srm.SRM3D_u16(image, Q=Q)
+    srm.segment()
+    srm.save_checkpoint(str(path))
+    path.write_bytes(path.read_bytes()[: path.stat().st_size // 2])
+
+    resumed = dpm_srm.SRM3D_u16(image, Q=Q)
+    with pytest.raises(RuntimeError):
+        resumed.load_checkpoint(str(path))
+    with pytest.raises(RuntimeError):
+        resumed.resume()
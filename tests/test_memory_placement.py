@@ -0,0 +1,37 @@
+import numpy as np
+import pytest
+import dpm_srm
+
+Q = 5.0
+
+
+@pytest.fixture(params=[(20, 30, 40), (120, 90)], ids=["3D", "2D"])
+def image(request):
+    rng = np.random.default_rng(130621)
+    return rng.integers(0, 256, size=request.param, dtype=np.uint8)
+
+
+def make_srm(image, **kwargs):
+    cls = dpm_srm.SRM3D_u8 if image.ndim == 3 else dpm_srm.SRM2D_u8
+    return cls(image, Q=Q, **kwargs)
+
+
+def test_threads_and_huge_pages_match_defaults(image):
+    reference = make_srm(image)
+    reference.segment()
+    srm = make_srm(image, n_threads=4, huge_pages=True)
+    srm.segment()
+    np.testing.assert_array_equal(srm.get_result(), reference.get_result())
+
+
+@pytest.mark.parametrize("huge_pages", [False, True])
+def test_memory_placement_reports_region_state(image, huge_pages):
+    srm = make_srm(image, n_threads=4, huge_pages=huge_pages)
+    srm.segment()
+    placement = srm.memory_placement()
+    assert set(placement) == {"average", "count", "regionIndex"}
+    for array in placement.values():
+        assert set(array) == {"bytes", "huge_page_bytes", "numa_nodes"}
+        assert array["bytes"] == 8 * image.size
+        assert 0 <= array["huge_page_bytes"] <= array["bytes"]
+        assert sum(array["numa_nodes"].values()) <= array["bytes"]
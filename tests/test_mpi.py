@@ -0,0 +1,47 @@
+"""Smoke test of the MPI slab backend. Runs this file under mpirun as the worker."""
+import os
+import shutil
+import subprocess
+import sys
+import numpy as np
+import pytest
+import dpm_srm
+
+Q = 5.0
+
+
+def piecewise_constant_volume():
+    # 16^3 blocks of 0, 120 and 240; the slab boundary of 3 ranks cuts through blocks
+    z, y, x = np.indices((48, 48, 48))
+    return (120 * ((x // 16 + y // 16 + z // 16) % 3)).astype(np.uint8)
+
+
+@pytest.mark.skipif(not hasattr(dpm_srm, "segment_slab_mpi_u8"),
+                    reason="built without DPM_SRM_WITH_MPI")
+@pytest.mark.skipif(shutil.which("mpirun") is None, reason="mpirun not found")
+@pytest.mark.parametrize("n_ranks", [2, 3])
+def test_mpi_slabs_match_serial(n_ranks):
+    pytest.importorskip("mpi4py")
+    env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+    subprocess.run(["mpirun", "-np", str(n_ranks), sys.executable, __file__],
+                   env=env, check=True, timeout=300)
+
+
+def worker():
+    from mpi4py import MPI
+    comm = MPI.COMM_WORLD
+    rank, size = comm.Get_rank(), comm.Get_size()
+
+    image = piecewise_constant_volume()
+    depth = image.shape[0]
+    z0, z1 = depth * rank // size, depth * (rank + 1) // size
+    result = dpm_srm.segment_slab_mpi_u8(np.ascontiguousarray(image[z0:z1]), Q=Q,
+                                         z_offset=z0, global_depth=depth)
+
+    srm = dpm_srm.SRM3D_u8(image, Q=Q)
+    srm.segment()
+    np.testing.assert_array_equal(result, srm.get_result()[z0:z1])
+
+
+if __name__ == "__main__":
+    worker()
@@ -0,0 +1,30 @@
+import numpy as np
+import pytest
+import dpm_srm
+
+pytestmark = pytest.mark.skipif(not hasattr(dpm_srm, "segment_slabs_u8"),
+                                reason="process-pool slab backend needs fork()")
+
+Q = 5.0
+
+
+def serial(image):
+    srm = dpm_srm.SRM3D_u8(image, Q=Q)
+    srm.segment()
+    return srm.get_result()
+
+
+def test_single_slab_matches_serial():
+    rng = np.random.default_rng(130621)
+    image = rng.integers(0, 256, size=(32, 40, 48), dtype=np.uint8)
+    result = dpm_srm.segment_slabs_u8(image, Q=Q, n_procs=1)
+    np.testing.assert_array_equal(result, serial(image))
+
+
+@pytest.mark.parametrize("n_procs", [2, 3, 4, 5])
+def test_piecewise_constant_volume_matches_serial(n_procs):
+    # 16^3 blocks of 0, 120 and 240; slab boundaries for n_procs = 3 and 5 cut through blocks
+    z, y, x = np.indices((64, 64, 64))
+    image = (120 * ((x // 16 + y // 16 + z // 16) % 3)).astype(np.uint8)
+    result = dpm_srm.segment_slabs_u8(image, Q=Q, n_procs=n_procs)
+    np.testing.assert_array_equal(result, serial(image))
@@ -1,9 +1,11 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
+#include <pybind11/functional.h>
 #include "SRM.hpp"
 #include "SRM3D.hpp"
 #include "SRM2D.hpp"
+#include "SRMDistributed.hpp"
 
 namespace py = pybind11;
 
@@ -13,10 +15,21 @@ void wrap_srm3d(py::module &m, const std::string &suffix)
 {
     std::string class_name = "SRM3D_" + suffix;
     py::class_<SRM3D<T>>(m, class_name.c_str())
-        .def(py::init<const py::array_t<T> &, double>(),
-             py::arg("image"), py::arg("Q"))
-        .def("segment", &SRM3D<T>::segment)
-        .def("get_result", &SRM3D<T>::getSegmentation);
+        .def(py::init<const py::array_t<T> &, double, int, bool>(),
+             py::arg("image"), py::arg("Q"), py::arg("n_threads") = 1, py::arg("huge_pages") = false)
+        .def("segment", &SRM3D<T>::segment, py::call_guard<py::gil_scoped_release>())
+        .def("resume", &SRM3D<T>::resume, py::call_guard<py::gil_scoped_release>())
+        .def("cancel", &SRM3D<T>::cancel)
+        .def("set_progress_callback", &SRM3D<T>::setProgressCallback,
+             py::arg("callback"), py::arg("interval") = 1.0)
+        .def("set_checkpoint", &SRM3D<T>::setCheckpoint,
+             py::arg("path"), py::arg("interval") = 600.0)
+        .def("save_checkpoint", &SRM3D<T>::saveCheckpoint, py::arg("path"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("load_checkpoint", &SRM3D<T>::loadCheckpoint, py::arg("path"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("get_result", &SRM3D<T>::getSegmentation)
+        .def("memory_placement", &SRM3D<T>::getMemoryPlacement);
 }
 
 template <typename T>
@@ -24,19 +37,50 @@ void wrap_srm2d(py::module &m, const std::string &suffix)
 {
     std::string class_name = "SRM2D_" + suffix;
     py::class_<SRM2D<T>>(m, class_name.c_str())
-        .def(py::init<const py::array_t<T> &, double>(),
-             py::arg("image"), py::arg("Q"))
-        .def("segment", &SRM2D<T>::segment)
-        .def("get_result", &SRM2D<T>::getSegmentation);
+        .def(py::init<const py::array_t<T> &, double, int, bool>(),
+             py::arg("image"), py::arg("Q"), py::arg("n_threads") = 1, py::arg("huge_pages") = false)
+        .def("segment", &SRM2D<T>::segment, py::call_guard<py::gil_scoped_release>())
+        .def("resume", &SRM2D<T>::resume, py::call_guard<py::gil_scoped_release>())
+        .def("cancel", &SRM2D<T>::cancel)
+        .def("set_progress_callback", &SRM2D<T>::setProgressCallback,
+             py::arg("callback"), py::arg("interval") = 1.0)
+        .def("set_checkpoint", &SRM2D<T>::setCheckpoint,
+             py::arg("path"), py::arg("interval") = 600.0)
+        .def("save_checkpoint", &SRM2D<T>::saveCheckpoint, py::arg("path"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("load_checkpoint", &SRM2D<T>::loadCheckpoint, py::arg("path"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("get_result", &SRM2D<T>::getSegmentation)
+        .def("memory_placement", &SRM2D<T>::getMemoryPlacement);
+}
+
+// Template function to wrap the slab-decomposed 3D backends
+template <typename T>
+void wrap_srm_slabs(py::module &m, const std::string &suffix)
+{
+#ifdef DPM_SRM_HAVE_FORK
+    std::string forked_name = "segment_slabs_" + suffix;
+    m.def(forked_name.c_str(), &segmentSlabsForked<T>,
+          py::arg("image"), py::arg("Q"), py::arg("n_procs"));
+#endif
+#ifdef DPM_SRM_WITH_MPI
+    std::string mpi_name = "segment_slab_mpi_" + suffix;
+    m.def(mpi_name.c_str(), &segmentSlabMPI<T>,
+          py::arg("slab"), py::arg("Q"), py::arg("z_offset"), py::arg("global_depth"));
+#endif
 }
 
 PYBIND11_MODULE(dpm_srm, m)
 {
     m.doc() = "Statistical Region Merging (SRM) Segmentation module";
+    py::register_exception<SegmentationCancelled>(m, "SegmentationCancelled", PyExc_RuntimeError);
     wrap_srm3d<uint8_t>(m, "u8");
     wrap_srm3d<uint16_t>(m, "u16");
     wrap_srm3d<uint32_t>(m, "u32");
     wrap_srm2d<uint8_t>(m, "u8");
     wrap_srm2d<uint16_t>(m, "u16");
     wrap_srm2d<uint32_t>(m, "u32");
+    wrap_srm_slabs<uint8_t>(m, "u8");
+    wrap_srm_slabs<uint16_t>(m, "u16");
+    wrap_srm_slabs<uint32_t>(m, "u32");
 }